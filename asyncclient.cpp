@@ -0,0 +1,437 @@
+#include "asyncclient.h"
+#include "utilities.h"
+#include <iostream>
+#include <format>
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+static dkvs::ServerMessage getErrorMessage(dkvs::Status status, const std::string& errorMessage) {
+    dkvs::ServerMessage serverMessage;
+    serverMessage.set_status(status);
+    serverMessage.set_error_message(errorMessage);
+    return serverMessage;
+}
+
+AsyncClient::AsyncClient(const std::vector<Node>& nodes, AsyncClientOptions options) :
+m_options{options},
+m_hashRing{nodes}
+{
+    for (const auto& node : nodes)
+        m_nodeStates[node];
+}
+
+AsyncClient::~AsyncClient() {
+    try {
+        run(drainBackgroundTasks());
+        run([](AsyncClient& client) -> Task<void> {
+            client.closeConnections();
+            co_return;
+        }(*this));
+    } catch (std::exception& e) {
+        std::cerr << std::format("Failed to shut down client cleanly: {}", e.what()) << std::endl;
+    }
+}
+
+std::shared_ptr<AsyncClient::Connection> AsyncClient::getConnection(const Node& node) {
+    NodeState& state = m_nodeStates.at(node);
+    // reuse the least loaded connection unless it is busy and the pool still has room
+    std::shared_ptr<Connection> leastLoaded;
+    for (auto& connection : state.connections)
+        if (!leastLoaded || connection->pending.size() < leastLoaded->pending.size()) leastLoaded = connection;
+    if (leastLoaded && (leastLoaded->pending.empty() || state.connections.size() >= m_options.connectionsPerNode))
+        return leastLoaded;
+
+    auto connection = std::make_shared<Connection>();
+    connection->node = node;
+    state.connections.push_back(connection);
+    spawn(openConnection(connection));
+    return connection;
+}
+
+Task<void> AsyncClient::openConnection(std::shared_ptr<Connection> connection) {
+    try {
+        sockaddr_in socketAddress = getSocketAddress(connection->node);
+        int socketfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (socketfd == -1)
+            throw std::runtime_error(std::format("Couldn't create client socket: {}", std::string(strerror(errno))));
+        int opt = 1;
+        if (setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1) {
+            cleanup(socketfd);
+            throw std::runtime_error(std::format("setsockopt failed: {}", std::string(strerror(errno))));
+        }
+        if (connect(socketfd, (const sockaddr*)&socketAddress, sizeof(struct sockaddr_in)) == -1 && errno != EINPROGRESS) {
+            std::string error{strerror(errno)};
+            cleanup(socketfd);
+            throw std::runtime_error(std::format("Couldn't connect client socket to server {}:{} -- {}", connection->node.ip, connection->node.port, error));
+        }
+        // watched once the connect is under way, the socket reports writable when it completes
+        try {
+            m_loop.watch(socketfd);
+        } catch (std::runtime_error& e) {
+            cleanup(socketfd);
+            throw;
+        }
+        connection->socketfd = socketfd;
+    } catch (std::runtime_error& e) {
+        failConnection(connection, e.what());
+        co_return;
+    }
+
+    co_await m_loop.writable(connection->socketfd);
+    if (connection->broken) co_return;
+    int error{0};
+    socklen_t errorLength = sizeof(error);
+    if (getsockopt(connection->socketfd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == -1) error = errno;
+    if (error) {
+        failConnection(connection, std::format("Couldn't connect client socket to server {}:{} -- {}", connection->node.ip, connection->node.port, std::string(strerror(error))));
+        co_return;
+    }
+
+    connection->connected = true;
+    spawn(readResponses(connection));
+    flush(connection);
+}
+
+Task<void> AsyncClient::readResponses(std::shared_ptr<Connection> connection) {
+    std::string& buffer = connection->readBuffer;
+    while (!connection->broken) {
+        size_t oldSize = buffer.size();
+        buffer.resize(oldSize + READ_CHUNK_SIZE);
+        ssize_t bytesRead = recv(connection->socketfd, buffer.data() + oldSize, READ_CHUNK_SIZE, 0);
+        buffer.resize(oldSize + static_cast<size_t>(std::max(bytesRead, static_cast<ssize_t>(0))));
+        if (bytesRead == 0) {
+            failConnection(connection, "Connection closed by server");
+            co_return;
+        }
+        if (bytesRead < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                co_await m_loop.readable(connection->socketfd);
+                continue;
+            }
+            failConnection(connection, std::format("Failed to read response: {}", std::string(strerror(errno))));
+            co_return;
+        }
+
+        // same length prefixed frames as getMessage
+        size_t offset{0};
+        while (buffer.size() - offset >= sizeof(uint32_t)) {
+            uint32_t len_n;
+            std::memcpy(&len_n, buffer.data() + offset, sizeof(len_n));
+            size_t len = ntohl(len_n);
+            if (buffer.size() - offset - sizeof(uint32_t) < len) break;
+            dkvs::ServerMessage serverMessage;
+            if (!serverMessage.ParseFromArray(buffer.data() + offset + sizeof(uint32_t), static_cast<int>(len))) {
+                failConnection(connection, "Failed to parse server message");
+                co_return;
+            }
+            offset += sizeof(uint32_t) + len;
+            // responses to requests that already timed out are dropped
+            auto it = connection->pending.find(serverMessage.request_id());
+            if (it == connection->pending.end()) continue;
+            PendingRequest* request = it->second;
+            connection->pending.erase(it);
+            completeRequest(request, std::move(serverMessage));
+        }
+        buffer.erase(0, offset);
+    }
+}
+
+Task<void> AsyncClient::flushWhenWritable(std::shared_ptr<Connection> connection) {
+    co_await m_loop.writable(connection->socketfd);
+    connection->waitingWritable = false;
+    if (!connection->broken) flush(connection);
+}
+
+// requests made in the same loop iteration go out in one send
+void AsyncClient::scheduleFlush(const std::shared_ptr<Connection>& connection) {
+    if (connection->flushScheduled) return;
+    connection->flushScheduled = true;
+    m_loop.post([this, connection](){
+        connection->flushScheduled = false;
+        flush(connection);
+    });
+}
+
+void AsyncClient::flush(const std::shared_ptr<Connection>& connection) {
+    if (!connection->connected || connection->broken || connection->waitingWritable) return;
+    std::string& buffer = connection->writeBuffer;
+    while (connection->writeOffset < buffer.size()) {
+        ssize_t bytesSent = send(connection->socketfd, buffer.data() + connection->writeOffset, buffer.size() - connection->writeOffset, MSG_NOSIGNAL);
+        if (bytesSent >= 0) {
+            connection->writeOffset += static_cast<size_t>(bytesSent);
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            connection->waitingWritable = true;
+            spawn(flushWhenWritable(connection));
+            return;
+        }
+        failConnection(connection, std::format("Failed to send request: {}", std::string(strerror(errno))));
+        return;
+    }
+    buffer.clear();
+    connection->writeOffset = 0;
+}
+
+void AsyncClient::closeConnection(const std::shared_ptr<Connection>& connection, const std::string& reason) {
+    if (connection->broken) return;
+    connection->broken = true;
+    if (connection->socketfd != -1) {
+        m_loop.unwatch(connection->socketfd);
+        cleanup(connection->socketfd);
+        connection->socketfd = -1;
+    }
+    std::erase(m_nodeStates.at(connection->node).connections, connection);
+
+    auto pending = std::move(connection->pending);
+    connection->pending.clear();
+    for (auto& [requestId, request] : pending)
+        completeRequest(request, getErrorMessage(dkvs::Status::ERROR, reason));
+}
+
+void AsyncClient::failConnection(const std::shared_ptr<Connection>& connection, const std::string& reason) {
+    if (connection->broken) return;
+    closeConnection(connection, reason);
+    // skip the node for a while instead of paying a connect attempt on every request
+    m_nodeStates.at(connection->node).downUntil = std::chrono::steady_clock::now() + m_options.nodeDownBackoff;
+    std::cerr << std::format("Connection to server {}:{} failed: {}", connection->node.ip, connection->node.port, reason) << std::endl;
+}
+
+// the waiter is resumed from the loop's ready queue so completions never run inside I/O handling
+void AsyncClient::completeRequest(PendingRequest* request, dkvs::ServerMessage response) {
+    request->response = std::move(response);
+    m_loop.post([request](){ request->waiter.resume(); });
+}
+
+// hands the slot straight to the next waiting request, or frees it
+void AsyncClient::releaseSlot(NodeState& state) {
+    if (state.slotWaiters.empty()) {
+        state.numInFlight--;
+        return;
+    }
+    std::coroutine_handle<> waiter = state.slotWaiters.front();
+    state.slotWaiters.pop_front();
+    m_loop.post([waiter](){ waiter.resume(); });
+}
+
+Task<dkvs::ServerMessage> AsyncClient::sendRequest(Node node, NodeState& state, dkvs::ClientMessage clientMessage, std::chrono::steady_clock::time_point timeoutAt) {
+    co_await acquireSlot(state);
+    InFlightSlot slot{*this, state};
+    // the request may have waited for its slot long enough for either of these to change
+    if (std::chrono::steady_clock::now() >= timeoutAt)
+        co_return getErrorMessage(dkvs::Status::ERROR, "Request timed out");
+    if (std::chrono::steady_clock::now() < state.downUntil)
+        co_return getErrorMessage(dkvs::Status::ERROR, std::format("Server {}:{} is marked down", node.ip, node.port));
+
+    uint64_t requestId = m_nextRequestId++;
+    clientMessage.set_request_id(requestId);
+    std::string body = clientMessage.SerializeAsString();
+
+    std::shared_ptr<Connection> connection = getConnection(node);
+    if (connection->broken)
+        co_return getErrorMessage(dkvs::Status::ERROR, std::format("Couldn't connect to server {}:{}", node.ip, node.port));
+    PendingRequest request;
+    connection->pending[requestId] = &request;
+    uint32_t len_n = htonl(static_cast<uint32_t>(body.size()));
+    connection->writeBuffer.append(reinterpret_cast<const char*>(&len_n), sizeof(len_n));
+    connection->writeBuffer.append(body);
+    scheduleFlush(connection);
+
+    EventLoop::TimerId timeoutTimer = m_loop.addTimer(timeoutAt, [this, weakConnection = std::weak_ptr<Connection>(connection), requestId](){
+        std::shared_ptr<Connection> connection = weakConnection.lock();
+        if (!connection) return;
+        auto it = connection->pending.find(requestId);
+        if (it == connection->pending.end()) return;
+        PendingRequest* request = it->second;
+        connection->pending.erase(it);
+        completeRequest(request, getErrorMessage(dkvs::Status::ERROR, "Request timed out"));
+    });
+
+    struct ResponseAwaiter {
+        PendingRequest& request;
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> handle) noexcept {request.waiter = handle;}
+        void await_resume() const noexcept {}
+    };
+    co_await ResponseAwaiter{request};
+    // only requests still in flight keep a timer, not every request of the last requestTimeout
+    m_loop.cancelTimer(timeoutTimer);
+    co_return std::move(request.response);
+}
+
+Task<dkvs::ServerMessage> AsyncClient::call(Node node, dkvs::ClientMessage clientMessage) {
+    co_await m_loop.schedule();
+    auto stateIt = m_nodeStates.find(node);
+    if (stateIt == m_nodeStates.end())
+        co_return getErrorMessage(dkvs::Status::INVALID, std::format("Server {}:{} is not part of the cluster", node.ip, node.port));
+    if (std::chrono::steady_clock::now() < stateIt->second.downUntil)
+        co_return getErrorMessage(dkvs::Status::ERROR, std::format("Server {}:{} is marked down", node.ip, node.port));
+
+    auto timeoutAt = std::chrono::steady_clock::now() + m_options.requestTimeout;
+    if (!clientMessage.has_deadline_ms())
+        clientMessage.set_deadline_ms(getCurrentTimeMs() + static_cast<uint64_t>(m_options.requestTimeout.count()));
+    for (size_t attempt = 0;; attempt++) {
+        dkvs::ServerMessage response = co_await sendRequest(node, stateIt->second, clientMessage, timeoutAt);
+        if (response.status() != dkvs::Status::OVERLOADED || attempt >= m_options.overloadedRetries) co_return response;
+        auto retryAt = std::chrono::steady_clock::now() + m_options.overloadedBackoff * (size_t{1} << attempt);
+        if (retryAt >= timeoutAt) co_return response;
+        co_await m_loop.sleepUntil(retryAt);
+    }
+}
+
+Task<GetResult> AsyncClient::get(std::string key) {
+    co_await m_loop.schedule();
+    std::vector<Node> servers = m_hashRing.getNodesForKey(key);
+    size_t numServers = servers.size();
+    size_t thresholdForCompletion = m_hashRing.getNumNodes()/2 + 1;
+
+    dkvs::ClientMessage clientMessage;
+    clientMessage.mutable_get()->set_key(key);
+
+    // shared with the replica calls, which may finish after we have our quorum
+    struct Quorum {
+        std::vector<dkvs::ServerMessage> responses;
+        size_t numResponses{0};
+        size_t numOk{0};
+        bool reached{false};
+        CompletionEvent done;
+    };
+    auto quorum = std::make_shared<Quorum>();
+    quorum->responses.resize(numServers);
+    for (size_t i = 0; i < numServers; i++) {
+        spawn([](AsyncClient& client, std::shared_ptr<Quorum> quorum, Node server, dkvs::ClientMessage clientMessage, size_t i, size_t thresholdForCompletion) -> Task<void> {
+            dkvs::ServerMessage response = co_await client.call(server, std::move(clientMessage));
+            quorum->numResponses++;
+            if (response.status() == dkvs::Status::OK && response.has_get()) quorum->numOk++;
+            quorum->responses[i] = std::move(response);
+            size_t numFailed = quorum->numResponses - quorum->numOk;
+            // stop as soon as we have a quorum or can no longer get one
+            if (!quorum->reached && (quorum->numOk >= thresholdForCompletion || numFailed > quorum->responses.size() - thresholdForCompletion)) {
+                quorum->reached = true;
+                quorum->done.set();
+            }
+        }(*this, quorum, servers[i], clientMessage, i, thresholdForCompletion));
+    }
+    co_await quorum->done;
+
+    GetResult result{.status{dkvs::Status::OK}, .found{false}, .value{}, .timestamp{0}, .errorMessage{}};
+    if (quorum->numOk < thresholdForCompletion) {
+        bool overloaded = std::any_of(quorum->responses.begin(), quorum->responses.end(), [](const dkvs::ServerMessage& response){
+            return response.status() == dkvs::Status::OVERLOADED;
+        });
+        result.status = overloaded ? dkvs::Status::OVERLOADED : dkvs::Status::ERROR;
+        result.errorMessage = std::format("Couldn't reach a quorum of {} replicas, {} answered and {} failed", thresholdForCompletion, quorum->numOk, quorum->numResponses - quorum->numOk);
+        co_return result;
+    }
+
+    for (const auto& response : quorum->responses) {
+        if (response.status() != dkvs::Status::OK || !response.has_get() || !response.get().found()) continue;
+        if (!result.found || response.get().timestamp() > result.timestamp) {
+            result.found = true;
+            result.value = response.get().value();
+            result.timestamp = response.get().timestamp();
+        }
+    }
+    if (result.found)
+        tryReadRepair(key, servers, quorum->responses, result);
+    co_return result;
+}
+
+void AsyncClient::tryReadRepair(const std::string& key, const std::vector<Node>& servers, const std::vector<dkvs::ServerMessage>& responses, const GetResult& chosenResult) {
+    for (size_t i = 0; i < servers.size(); i++) {
+        const dkvs::ServerMessage& response = responses[i];
+        // only repair replicas that answered, the others may be down
+        if (response.status() != dkvs::Status::OK || !response.has_get()) continue;
+        if (response.get().found() && response.get().timestamp() == chosenResult.timestamp && response.get().value() == chosenResult.value) continue;
+
+        dkvs::ClientMessage clientMessage;
+        clientMessage.set_priority(dkvs::Priority::READ_REPAIR);
+        dkvs::PutRequest* putRequest = clientMessage.mutable_put();
+        putRequest->set_key(key);
+        putRequest->set_value(chosenResult.value);
+        putRequest->set_timestamp(chosenResult.timestamp);
+        spawnBackground([](AsyncClient& client, Node server, dkvs::ClientMessage clientMessage) -> Task<void> {
+            dkvs::ServerMessage response = co_await client.call(server, std::move(clientMessage));
+            if (response.status() != dkvs::Status::OK)
+                std::cerr << std::format("Read repair of server {}:{} failed: {}", server.ip, server.port, response.error_message()) << std::endl;
+        }(*this, servers[i], std::move(clientMessage)));
+    }
+}
+
+Task<PutResult> AsyncClient::put(std::string key, std::string value) {
+    co_await m_loop.schedule();
+    Node server = m_hashRing.getNodeForKey(key);
+    dkvs::ClientMessage clientMessage;
+    clientMessage.set_priority(dkvs::Priority::CLIENT);
+    clientMessage.mutable_put()->set_key(std::move(key));
+    clientMessage.mutable_put()->set_value(std::move(value));
+    dkvs::ServerMessage response = co_await call(server, std::move(clientMessage));
+    co_return PutResult{
+        .status{response.status()},
+        .success{response.status() == dkvs::Status::OK && response.has_put() && response.put().success()},
+        .errorMessage{response.error_message()},
+    };
+}
+
+Task<std::vector<GetResult>> AsyncClient::getBatch(std::vector<std::string> keys) {
+    std::vector<Task<GetResult>> tasks;
+    tasks.reserve(keys.size());
+    for (auto& key : keys) tasks.push_back(get(std::move(key)));
+    co_await m_loop.schedule();
+    co_return co_await whenAll(std::move(tasks));
+}
+
+Task<std::vector<PutResult>> AsyncClient::putBatch(std::vector<std::pair<std::string, std::string>> entries) {
+    std::vector<Task<PutResult>> tasks;
+    tasks.reserve(entries.size());
+    for (auto& [key, value] : entries) tasks.push_back(put(std::move(key), std::move(value)));
+    co_await m_loop.schedule();
+    co_return co_await whenAll(std::move(tasks));
+}
+
+Task<StatsResult> AsyncClient::stats(Node node) {
+    dkvs::ClientMessage clientMessage;
+    clientMessage.mutable_stats();
+    dkvs::ServerMessage response = co_await call(node, std::move(clientMessage));
+    dkvs::Status status = response.status();
+    if (status == dkvs::Status::OK && !response.has_stats()) status = dkvs::Status::ERROR;
+    co_return StatsResult{
+        .status{status},
+        .stats{response.stats()},
+        .errorMessage{response.error_message()},
+    };
+}
+
+void AsyncClient::spawnBackground(Task<void> task) {
+    m_numBackgroundTasks++;
+    spawn([](AsyncClient& client, Task<void> task) -> Task<void> {
+        try {
+            co_await task;
+        } catch (std::exception& e) {
+            std::cerr << std::format("Background task failed: {}", e.what()) << std::endl;
+        }
+        if (--client.m_numBackgroundTasks == 0 && client.m_backgroundTasksDone)
+            std::exchange(client.m_backgroundTasksDone, nullptr)->set();
+    }(*this, std::move(task)));
+}
+
+Task<void> AsyncClient::drainBackgroundTasks() {
+    co_await m_loop.schedule();
+    if (m_numBackgroundTasks == 0) co_return;
+    CompletionEvent done;
+    m_backgroundTasksDone = &done;
+    co_await done;
+}
+
+void AsyncClient::closeConnections() {
+    for (auto& [node, state] : m_nodeStates) {
+        auto connections = state.connections;
+        for (auto& connection : connections)
+            closeConnection(connection, "Client is shutting down");
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef ASYNCCLIENT_H
+#define ASYNCCLIENT_H
+
+#include "task.h"
+#include "eventloop.h"
+#include "hashring.h"
+#include "nodes.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "./protobufs/generated/dkvs.pb.h"
+
+struct AsyncClientOptions {
+    std::chrono::milliseconds requestTimeout{30000};
+    size_t connectionsPerNode{2};
+    // how long a node that refused or dropped a connection is skipped for
+    std::chrono::milliseconds nodeDownBackoff{1000};
+    // requests sent to one node at once, the rest wait in the client so they don't overrun
+    // the node's admission queues and come back OVERLOADED
+    size_t maxInFlightPerNode{128};
+    // OVERLOADED requests were shed before doing any work, so they are retried after a backoff
+    // that doubles each time, as long as the request timeout allows
+    size_t overloadedRetries{4};
+    std::chrono::milliseconds overloadedBackoff{10};
+};
+
+struct GetResult {
+    dkvs::Status status;
+    bool found;
+    std::string value;
+    uint64_t timestamp;
+    std::string errorMessage;
+};
+
+struct PutResult {
+    dkvs::Status status;
+    bool success;
+    std::string errorMessage;
+};
+
+struct StatsResult {
+    dkvs::Status status;
+    dkvs::StatsResponse stats;
+    std::string errorMessage;
+};
+
+// Non blocking client. Every request is multiplexed over a small pool of persistent
+// connections per node and driven by one event loop thread, so thousands of requests can
+// be in flight at once. Operations are co_await-able Tasks; awaiting coroutines continue
+// on the event loop thread. Use run() to wait for a Task from an ordinary thread.
+class AsyncClient {
+    struct PendingRequest {
+        dkvs::ServerMessage response;
+        std::coroutine_handle<> waiter;
+    };
+
+    struct Connection {
+        Node node;
+        int socketfd{-1};
+        bool connected{false};
+        bool broken{false};
+        bool flushScheduled{false};
+        bool waitingWritable{false};
+        std::string writeBuffer;
+        size_t writeOffset{0};
+        std::string readBuffer;
+        std::unordered_map<uint64_t, PendingRequest*> pending;
+    };
+
+    struct NodeState {
+        std::vector<std::shared_ptr<Connection>> connections;
+        std::chrono::steady_clock::time_point downUntil{};
+        size_t numInFlight{0};
+        std::deque<std::coroutine_handle<>> slotWaiters;
+    };
+
+    // holds one of a node's maxInFlightPerNode slots and hands it on when destroyed
+    struct InFlightSlot {
+        AsyncClient& client;
+        NodeState& state;
+        InFlightSlot(AsyncClient& client, NodeState& state) : client{client}, state{state} {}
+        ~InFlightSlot() {client.releaseSlot(state);}
+        InFlightSlot(const InFlightSlot&) = delete;
+        InFlightSlot& operator=(const InFlightSlot&) = delete;
+    };
+
+    AsyncClientOptions m_options;
+    HashRing m_hashRing;
+    std::map<Node, NodeState> m_nodeStates;
+    uint64_t m_nextRequestId{1};
+    size_t m_numBackgroundTasks{0};
+    CompletionEvent* m_backgroundTasksDone{nullptr};
+    // declared last so the loop thread stops before anything it touches is destroyed
+    EventLoop m_loop;
+
+    std::shared_ptr<Connection> getConnection(const Node& node);
+    Task<void> openConnection(std::shared_ptr<Connection> connection);
+    Task<void> readResponses(std::shared_ptr<Connection> connection);
+    Task<void> flushWhenWritable(std::shared_ptr<Connection> connection);
+    void scheduleFlush(const std::shared_ptr<Connection>& connection);
+    void flush(const std::shared_ptr<Connection>& connection);
+    void closeConnection(const std::shared_ptr<Connection>& connection, const std::string& reason);
+    void failConnection(const std::shared_ptr<Connection>& connection, const std::string& reason);
+    void completeRequest(PendingRequest* request, dkvs::ServerMessage response);
+    auto acquireSlot(NodeState& state) {
+        struct Awaiter {
+            AsyncClient& client;
+            NodeState& state;
+            bool await_ready() {
+                if (state.numInFlight >= client.m_options.maxInFlightPerNode) return false;
+                state.numInFlight++;
+                return true;
+            }
+            void await_suspend(std::coroutine_handle<> handle) {state.slotWaiters.push_back(handle);}
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this, state};
+    }
+    void releaseSlot(NodeState& state);
+    Task<dkvs::ServerMessage> sendRequest(Node node, NodeState& state, dkvs::ClientMessage clientMessage, std::chrono::steady_clock::time_point timeoutAt);
+    Task<dkvs::ServerMessage> call(Node node, dkvs::ClientMessage clientMessage);
+    void tryReadRepair(const std::string& key, const std::vector<Node>& servers, const std::vector<dkvs::ServerMessage>& responses, const GetResult& chosenResult);
+    void spawnBackground(Task<void> task);
+    Task<void> drainBackgroundTasks();
+    void closeConnections();
+
+public:
+    AsyncClient(const std::vector<Node>& nodes, AsyncClientOptions options = {});
+    ~AsyncClient();
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    // reads from a quorum of replicas, returns the newest value and repairs stale replicas in the background
+    Task<GetResult> get(std::string key);
+    Task<PutResult> put(std::string key, std::string value);
+    Task<std::vector<GetResult>> getBatch(std::vector<std::string> keys);
+    Task<std::vector<PutResult>> putBatch(std::vector<std::pair<std::string, std::string>> entries);
+    Task<StatsResult> stats(Node node);
+
+    // Blocks the calling thread until task finishes. Must not be called from the loop thread.
+    template <typename T>
+    T run(Task<T> task) {
+        if (m_loop.isInLoopThread())
+            throw std::logic_error("AsyncClient::run would deadlock on the event loop thread");
+        std::promise<T> promise;
+        std::future<T> future = promise.get_future();
+        spawn([](EventLoop& loop, Task<T> task, std::promise<T> promise) -> Task<void> {
+            co_await loop.schedule();
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    co_await task;
+                    promise.set_value();
+                } else {
+                    promise.set_value(co_await task);
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }(m_loop, std::move(task), std::move(promise)));
+        return future.get();
+    }
+};
+#endif // ASYNCCLIENT_H
@@ -0,0 +1,147 @@
+#include "compactstore.h"
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+static size_t getVarintSize(size_t value) {
+    size_t size = 1;
+    for (; value >= 0x80; value >>= 7) size++;
+    return size;
+}
+
+static std::byte* writeVarint(std::byte* data, size_t value) {
+    for (; value >= 0x80; value >>= 7) *data++ = static_cast<std::byte>(value | 0x80);
+    *data++ = static_cast<std::byte>(value);
+    return data;
+}
+
+static const std::byte* readVarint(const std::byte* data, size_t& value) {
+    value = 0;
+    for (size_t shift = 0;; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*data++);
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return data;
+    }
+}
+
+CompactStore::CompactStore() :
+m_tags(INITIAL_CAPACITY, EMPTY_TAG),
+m_entries(INITIAL_CAPACITY, NULL_BLOCK_REF)
+{}
+
+CompactStore::~CompactStore() {
+    for (size_t idx = 0; idx < m_tags.size(); idx++)
+        if (m_tags[idx] != EMPTY_TAG) destroyEntry(m_entries[idx]);
+}
+
+size_t CompactStore::getHash(std::string_view key) {
+    return std::hash<std::string_view>{}(key);
+}
+
+size_t CompactStore::getEntrySize(std::string_view key, std::string_view value) {
+    return sizeof(uint64_t) + getVarintSize(key.size()) + getVarintSize(value.size()) + key.size() + value.size();
+}
+
+void CompactStore::writeEntry(std::byte* block, std::string_view key, std::string_view value, uint64_t timestamp) {
+    std::memcpy(block, &timestamp, sizeof(timestamp));
+    std::byte* data = writeVarint(block + sizeof(timestamp), key.size());
+    data = writeVarint(data, value.size());
+    std::memcpy(data, key.data(), key.size());
+    std::memcpy(data + key.size(), value.data(), value.size());
+}
+
+CompactStore::Entry CompactStore::readEntry(const std::byte* block) {
+    Entry entry;
+    std::memcpy(&entry.timestamp, block, sizeof(entry.timestamp));
+    size_t keySize, valueSize;
+    const std::byte* data = readVarint(block + sizeof(entry.timestamp), keySize);
+    data = readVarint(data, valueSize);
+    entry.key = {reinterpret_cast<const char*>(data), keySize};
+    entry.value = {reinterpret_cast<const char*>(data) + keySize, valueSize};
+    return entry;
+}
+
+// returns the slot holding key, or the empty slot where it belongs
+size_t CompactStore::findSlot(std::string_view key, size_t hash) const {
+    size_t mask = m_tags.size() - 1;
+    uint8_t tag = getTag(hash);
+    for (size_t idx = hash & mask;; idx = (idx + 1) & mask) {
+        if (m_tags[idx] == EMPTY_TAG) return idx;
+        if (m_tags[idx] == tag && getEntry(m_entries[idx]).key == key) return idx;
+    }
+}
+
+BlockRef CompactStore::createEntry(std::string_view key, std::string_view value, uint64_t timestamp) {
+    if (key.size() > std::numeric_limits<uint32_t>::max() || value.size() > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Key or value is too large to store");
+    BlockRef ref = m_allocator.allocate(getEntrySize(key, value));
+    writeEntry(m_allocator.getBlock(ref), key, value, timestamp);
+    return ref;
+}
+
+void CompactStore::destroyEntry(BlockRef ref) {
+    Entry entry = getEntry(ref);
+    m_allocator.deallocate(ref, getEntrySize(entry.key, entry.value));
+}
+
+void CompactStore::grow() {
+    size_t capacity = m_tags.size() * 2;
+    std::vector<uint8_t> oldTags = std::exchange(m_tags, std::vector<uint8_t>(capacity, EMPTY_TAG));
+    std::vector<BlockRef> oldEntries = std::exchange(m_entries, std::vector<BlockRef>(capacity, NULL_BLOCK_REF));
+    for (size_t oldIdx = 0; oldIdx < oldTags.size(); oldIdx++) {
+        if (oldTags[oldIdx] == EMPTY_TAG) continue;
+        std::string_view key = getEntry(oldEntries[oldIdx]).key;
+        size_t hash = getHash(key);
+        size_t idx = findSlot(key, hash);
+        m_tags[idx] = getTag(hash);
+        m_entries[idx] = oldEntries[oldIdx];
+    }
+}
+
+std::optional<StoreEntryView> CompactStore::get(std::string_view key) const {
+    size_t idx = findSlot(key, getHash(key));
+    if (m_tags[idx] == EMPTY_TAG) return std::nullopt;
+    Entry entry = getEntry(m_entries[idx]);
+    return StoreEntryView{.value{entry.value}, .timestamp{entry.timestamp}};
+}
+
+void CompactStore::put(std::string_view key, std::string_view value, uint64_t timestamp) {
+    size_t hash = getHash(key);
+    size_t idx = findSlot(key, hash);
+    if (m_tags[idx] != EMPTY_TAG) {
+        BlockRef ref = m_entries[idx];
+        Entry entry = getEntry(ref);
+        m_payloadBytes = m_payloadBytes - entry.value.size() + value.size();
+        // overwrite in place when the new value lands in the same size class
+        if (m_allocator.getBlockSize(getEntrySize(entry.key, entry.value)) == m_allocator.getBlockSize(getEntrySize(key, value))) {
+            writeEntry(m_allocator.getBlock(ref), key, value, timestamp);
+            return;
+        }
+        m_entries[idx] = createEntry(key, value, timestamp);
+        destroyEntry(ref);
+        return;
+    }
+
+    // keep the load factor at or below 7/8 so probe sequences stay short
+    if ((m_numEntries + 1) * 8 > m_tags.size() * 7) {
+        grow();
+        idx = findSlot(key, hash);
+    }
+    m_entries[idx] = createEntry(key, value, timestamp);
+    m_tags[idx] = getTag(hash);
+    m_numEntries++;
+    m_payloadBytes += key.size() + value.size();
+}
+
+StoreMemoryStats CompactStore::getMemoryStats() const {
+    size_t tableBytes = m_tags.capacity() * sizeof(uint8_t) + m_entries.capacity() * sizeof(BlockRef);
+    return StoreMemoryStats{
+        .numEntries{m_numEntries},
+        .payloadBytes{m_payloadBytes},
+        .entryBytes{m_allocator.getAllocatedBytes()},
+        .tableBytes{tableBytes},
+        .reservedBytes{m_allocator.getReservedBytes() + tableBytes},
+    };
+}
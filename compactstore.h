@@ -0,0 +1,71 @@
+#ifndef COMPACTSTORE_H
+#define COMPACTSTORE_H
+
+#include "slaballocator.h"
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+struct StoreEntryView {
+    std::string_view value;
+    uint64_t timestamp;
+};
+
+struct StoreMemoryStats {
+    size_t numEntries;
+    size_t payloadBytes; // key and value bytes
+    size_t entryBytes;   // slab blocks holding entries
+    size_t tableBytes;
+    size_t reservedBytes; // everything the store holds from the system
+};
+
+// Key value store where each entry (timestamp, key and value) lives in a single slab block,
+// indexed by an open addressing table. Each slot keeps 7 bits of the key's hash next to a
+// 32 bit reference to the entry's block, so most mismatches are rejected without touching
+// the entry. Not thread safe.
+class CompactStore {
+    // An entry's block holds the 8 byte timestamp, then the key and value sizes as LEB128
+    // varints (a byte each below 128), then the key and value bytes.
+    struct Entry {
+        uint64_t timestamp;
+        std::string_view key;
+        std::string_view value;
+    };
+
+    static constexpr uint8_t EMPTY_TAG = 0;
+    static constexpr uint8_t FULL_TAG_BIT = 0x80;
+    static constexpr size_t INITIAL_CAPACITY = 16;
+
+    SlabAllocator m_allocator;
+    std::vector<uint8_t> m_tags;
+    std::vector<BlockRef> m_entries;
+    size_t m_numEntries{0};
+    size_t m_payloadBytes{0};
+
+    static size_t getHash(std::string_view key);
+    static uint8_t getTag(size_t hash) {return FULL_TAG_BIT | static_cast<uint8_t>(hash >> 57);};
+
+    static size_t getEntrySize(std::string_view key, std::string_view value);
+    static void writeEntry(std::byte* block, std::string_view key, std::string_view value, uint64_t timestamp);
+    static Entry readEntry(const std::byte* block);
+    Entry getEntry(BlockRef ref) const {return readEntry(m_allocator.getBlock(ref));};
+
+    size_t findSlot(std::string_view key, size_t hash) const;
+    BlockRef createEntry(std::string_view key, std::string_view value, uint64_t timestamp);
+    void destroyEntry(BlockRef ref);
+    void grow();
+
+public:
+    CompactStore();
+    ~CompactStore();
+    CompactStore(const CompactStore&) = delete;
+    CompactStore& operator=(const CompactStore&) = delete;
+
+    // the view is invalidated by the next put
+    std::optional<StoreEntryView> get(std::string_view key) const;
+    void put(std::string_view key, std::string_view value, uint64_t timestamp);
+    size_t size() const {return m_numEntries;};
+    StoreMemoryStats getMemoryStats() const;
+};
+#endif // COMPACTSTORE_H
@@ -0,0 +1,148 @@
+#include "eventloop.h"
+#include "utilities.h"
+#include <iostream>
+#include <format>
+#include <stdexcept>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+static const int MAX_EPOLL_EVENTS = 64;
+
+EventLoop::EventLoop() :
+m_epollfd{epoll_create1(EPOLL_CLOEXEC)},
+m_wakeupfd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+{
+    if (m_epollfd == -1 || m_wakeupfd == -1) {
+        if (m_epollfd != -1) cleanup(m_epollfd);
+        if (m_wakeupfd != -1) cleanup(m_wakeupfd);
+        throw std::runtime_error(std::format("Couldn't create event loop: {}", std::string(strerror(errno))));
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeupfd;
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakeupfd, &event) == -1) {
+        cleanup(m_epollfd);
+        cleanup(m_wakeupfd);
+        throw std::runtime_error(std::format("Couldn't watch event loop wakeup fd: {}", std::string(strerror(errno))));
+    }
+    m_thread = std::jthread([this](std::stop_token stoken){ run(stoken); });
+}
+
+EventLoop::~EventLoop() {
+    m_thread.request_stop();
+    wakeup();
+    m_thread.join();
+    cleanup(m_epollfd);
+    cleanup(m_wakeupfd);
+}
+
+void EventLoop::wakeup() {
+    uint64_t one{1};
+    if (write(m_wakeupfd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        perror("Couldn't wake up event loop");
+}
+
+void EventLoop::post(std::function<void()> callback) {
+    if (isInLoopThread()) {
+        m_ready.push_back(std::move(callback));
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_postedMtx);
+    m_posted.push_back(std::move(callback));
+    lock.unlock();
+    wakeup();
+}
+
+EventLoop::TimerId EventLoop::addTimer(std::chrono::steady_clock::time_point when, std::function<void()> callback) {
+    TimerId timerId{.when{when}, .id{m_nextTimerId++}};
+    m_timers.emplace(timerId, std::move(callback));
+    return timerId;
+}
+
+void EventLoop::cancelTimer(TimerId timerId) {
+    m_timers.erase(timerId);
+}
+
+void EventLoop::watch(int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) == -1)
+        throw std::runtime_error(std::format("Couldn't watch fd {}: {}", fd, std::string(strerror(errno))));
+    m_fdWaiters[fd] = FdWaiters{};
+}
+
+void EventLoop::unwatch(int fd) {
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, nullptr) == -1)
+        perror("Couldn't stop watching fd");
+    auto it = m_fdWaiters.find(fd);
+    if (it == m_fdWaiters.end()) return;
+    FdWaiters waiters = it->second;
+    m_fdWaiters.erase(it);
+    // resumed later so callers never see a waiter run underneath them
+    for (auto handle : {waiters.reader, waiters.writer})
+        if (handle) m_ready.push_back([handle](){ handle.resume(); });
+}
+
+int EventLoop::getEpollTimeoutMs() const {
+    if (!m_ready.empty()) return 0;
+    if (m_timers.empty()) return -1;
+    auto untilNextTimer = m_timers.begin()->first.when - std::chrono::steady_clock::now();
+    if (untilNextTimer <= std::chrono::steady_clock::duration::zero()) return 0;
+    // round up so we never wake just before the timer is due
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(untilNextTimer).count());
+}
+
+void EventLoop::runReady() {
+    std::unique_lock<std::mutex> lock(m_postedMtx);
+    std::vector<std::function<void()>> posted;
+    posted.swap(m_posted);
+    lock.unlock();
+    for (auto& callback : posted) callback();
+
+    while (!m_ready.empty()) {
+        std::vector<std::function<void()>> ready;
+        ready.swap(m_ready);
+        for (auto& callback : ready) callback();
+    }
+}
+
+void EventLoop::runTimers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!m_timers.empty() && m_timers.begin()->first.when <= now) {
+        auto callback = std::move(m_timers.begin()->second);
+        m_timers.erase(m_timers.begin());
+        callback();
+    }
+}
+
+void EventLoop::run(std::stop_token stoken) {
+    epoll_event events[MAX_EPOLL_EVENTS];
+    while (!stoken.stop_requested()) {
+        int numEvents = epoll_wait(m_epollfd, events, MAX_EPOLL_EVENTS, getEpollTimeoutMs());
+        if (numEvents == -1) {
+            if (errno == EINTR) continue;
+            std::cerr << std::format("Event loop failed to wait: {}", std::string(strerror(errno))) << std::endl;
+            return;
+        }
+        for (int i = 0; i < numEvents; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_wakeupfd) {
+                uint64_t count;
+                while (read(m_wakeupfd, &count, sizeof(count)) > 0);
+                continue;
+            }
+            auto it = m_fdWaiters.find(fd);
+            if (it == m_fdWaiters.end()) continue;
+            // a resumed waiter may unwatch fd, so take both handles out before resuming either
+            std::coroutine_handle<> reader, writer;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) reader = std::exchange(it->second.reader, {});
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) writer = std::exchange(it->second.writer, {});
+            if (reader) reader.resume();
+            if (writer) writer.resume();
+        }
+        runReady();
+        runTimers();
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <compare>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Single threaded epoll loop that resumes coroutines when their sockets are ready.
+// Sockets are watched edge triggered, so always read or write until EAGAIN before
+// waiting on them. Everything except post() must be called from the loop thread.
+class EventLoop {
+public:
+    // identifies a pending timer so it can be cancelled, ordered by when it fires
+    struct TimerId {
+        std::chrono::steady_clock::time_point when;
+        uint64_t id;
+        auto operator<=>(const TimerId&) const = default;
+    };
+
+private:
+    struct FdWaiters {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+    };
+
+    int m_epollfd;
+    int m_wakeupfd;
+    std::mutex m_postedMtx;
+    std::vector<std::function<void()>> m_posted;
+    std::vector<std::function<void()>> m_ready; // only touched by the loop thread
+    std::unordered_map<int, FdWaiters> m_fdWaiters;
+    std::map<TimerId, std::function<void()>> m_timers;
+    uint64_t m_nextTimerId{0};
+    std::jthread m_thread;
+
+    void run(std::stop_token stoken);
+    void wakeup();
+    int getEpollTimeoutMs() const;
+    void runReady();
+    void runTimers();
+
+public:
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool isInLoopThread() const {return std::this_thread::get_id() == m_thread.get_id();};
+    // runs callback on the loop thread, safe to call from any thread
+    void post(std::function<void()> callback);
+    TimerId addTimer(std::chrono::steady_clock::time_point when, std::function<void()> callback);
+    // drops the timer and its callback, does nothing if it already fired
+    void cancelTimer(TimerId timerId);
+
+    void watch(int fd);
+    // stops watching fd and resumes anything still waiting on it, call before closing fd
+    void unwatch(int fd);
+
+    // co_await to continue on the loop thread
+    auto schedule() {
+        struct Awaiter {
+            EventLoop& loop;
+            bool await_ready() const {return loop.isInLoopThread();}
+            void await_suspend(std::coroutine_handle<> handle) {loop.post([handle](){ handle.resume(); });}
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    // co_await to continue on the loop thread once when has passed
+    auto sleepUntil(std::chrono::steady_clock::time_point when) {
+        struct Awaiter {
+            EventLoop& loop;
+            std::chrono::steady_clock::time_point when;
+            bool await_ready() const noexcept {return false;}
+            void await_suspend(std::coroutine_handle<> handle) {loop.addTimer(when, [handle](){ handle.resume(); });}
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this, when};
+    }
+
+    // co_await until fd is readable, writable or unwatched
+    auto readable(int fd) {
+        struct Awaiter {
+            EventLoop& loop;
+            int fd;
+            bool await_ready() const noexcept {return false;}
+            void await_suspend(std::coroutine_handle<> handle) {loop.m_fdWaiters[fd].reader = handle;}
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this, fd};
+    }
+
+    auto writable(int fd) {
+        struct Awaiter {
+            EventLoop& loop;
+            int fd;
+            bool await_ready() const noexcept {return false;}
+            void await_suspend(std::coroutine_handle<> handle) {loop.m_fdWaiters[fd].writer = handle;}
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this, fd};
+    }
+};
+#endif // EVENTLOOP_H
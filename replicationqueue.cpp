@@ -0,0 +1,243 @@
+#include "replicationqueue.h"
+#include "utilities.h"
+#include <iostream>
+#include <format>
+#include <stdexcept>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+
+ReplicationQueue::Connection::~Connection() {
+    cleanup(socketfd);
+}
+
+ReplicationQueue::ReplicationQueue(const Node& replica, short primaryPort) :
+m_replica{replica},
+m_primaryPort{primaryPort}
+{
+    m_sender = std::jthread([this](std::stop_token stoken){ sendBatches(stoken); }, m_stopSource.get_token());
+    m_receiver = std::jthread([this](std::stop_token stoken){ receiveAcks(stoken); }, m_stopSource.get_token());
+}
+
+ReplicationQueue::~ReplicationQueue() {
+    m_stopSource.request_stop();
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_connection) shutdown(m_connection->socketfd, SHUT_RDWR); // unblocks the receiver
+    m_cv.notify_all();
+    lock.unlock();
+    m_sender.join();
+    m_receiver.join();
+    for (auto& pending : m_pending) pending.callback(false);
+    for (auto& batch : m_inFlight)
+        for (auto& callback : batch.callbacks) callback(false);
+}
+
+void ReplicationQueue::enqueue(const dkvs::PutRequest& request, std::optional<uint64_t> deadlineMs, Callback callback) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_pending.size() >= MAX_REPLICATION_PENDING_PUTS) {
+        lock.unlock();
+        callback(false);
+        return;
+    }
+    m_pendingBytes += request.ByteSizeLong();
+    m_pending.push_back(PendingPut{.request{request}, .callback{std::move(callback)}, .deadlineMs{deadlineMs}, .enqueuedAt{std::chrono::steady_clock::now()}});
+    m_cv.notify_all();
+}
+
+bool ReplicationQueue::isBatchFull() const {
+    return m_pending.size() >= MAX_REPLICATION_BATCH_PUTS || m_pendingBytes >= MAX_REPLICATION_BATCH_BYTES;
+}
+
+// caller must hold m_mtx
+std::vector<ReplicationQueue::Callback> ReplicationQueue::takeExpiredPuts(uint64_t nowMs) {
+    std::vector<Callback> expiredCallbacks;
+    std::erase_if(m_pending, [this, nowMs, &expiredCallbacks](PendingPut& pending){
+        if (!pending.deadlineMs || *pending.deadlineMs > nowMs) return false;
+        m_pendingBytes -= pending.request.ByteSizeLong();
+        expiredCallbacks.push_back(std::move(pending.callback));
+        return true;
+    });
+    return expiredCallbacks;
+}
+
+std::shared_ptr<ReplicationQueue::Connection> ReplicationQueue::connect() {
+    sockaddr_in socketAddress = getSocketAddress(m_replica);
+    auto connection = std::make_shared<Connection>(getSocketFd());
+    if (::connect(connection->socketfd, (const sockaddr*)&socketAddress, sizeof(struct sockaddr_in)) == -1)
+        throw std::runtime_error(std::format("Couldn't connect replication socket to server {}:{} -- {}", m_replica.ip, m_replica.port, std::string(strerror(errno))));
+    // batching happens here, so don't let the kernel delay small frames as well
+    int opt = 1;
+    if (setsockopt(connection->socketfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1)
+        throw std::runtime_error(std::format("setsockopt failed: {}", std::string(strerror(errno))));
+    // a replica that stops reading must not block the sender forever
+    timeval sendTimeout{.tv_sec{REPLICATION_ACK_TIMEOUT.count() / 1000}, .tv_usec{(REPLICATION_ACK_TIMEOUT.count() % 1000) * 1000}};
+    if (setsockopt(connection->socketfd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout)) == -1)
+        throw std::runtime_error(std::format("setsockopt failed: {}", std::string(strerror(errno))));
+    return connection;
+}
+
+void ReplicationQueue::failConnection(const std::shared_ptr<Connection>& connection) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_connection != connection) return;
+    m_connection.reset();
+    m_reconnectAfter = std::chrono::steady_clock::now() + REPLICATION_RECONNECT_BACKOFF;
+    std::deque<InFlightBatch> failedBatches;
+    failedBatches.swap(m_inFlight);
+    m_cv.notify_all();
+    lock.unlock();
+
+    shutdown(connection->socketfd, SHUT_RDWR);
+    for (auto& batch : failedBatches)
+        for (auto& callback : batch.callbacks) callback(false);
+}
+
+void ReplicationQueue::handleAck(const std::shared_ptr<Connection>& connection, const dkvs::ReplicateResponse& response) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_connection != connection) return;
+    if (m_inFlight.empty() || m_inFlight.front().batchId != response.batch_id())
+        throw std::runtime_error(std::format("Unexpected ack for replication batch {}", response.batch_id()));
+    InFlightBatch batch = std::move(m_inFlight.front());
+    m_inFlight.pop_front();
+    m_cv.notify_all();
+    lock.unlock();
+
+    std::cout << std::format("server on port {} replicated batch {} of {} puts to server on port {} up to timestamp {}", m_primaryPort, batch.batchId, batch.callbacks.size(), m_replica.port, response.applied_timestamp()) << std::endl;
+    for (auto& callback : batch.callbacks) callback(response.success());
+}
+
+void ReplicationQueue::sendBatches(std::stop_token stoken) {
+    while (!stoken.stop_requested()) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        bool canSend = m_cv.wait_for(lock, REPLICATION_SWEEP_INTERVAL, [this, &stoken](){
+            return stoken.stop_requested() || (!m_pending.empty() && m_inFlight.size() < MAX_REPLICATION_BATCHES_IN_FLIGHT);
+        });
+        if (stoken.stop_requested()) break;
+        // a replica that stopped acking without closing the connection would otherwise hold
+        // every in flight batch, and every put queued behind them, forever
+        if (!m_inFlight.empty() && std::chrono::steady_clock::now() - m_inFlight.front().sentAt >= REPLICATION_ACK_TIMEOUT) {
+            std::shared_ptr<Connection> connection = m_connection;
+            uint64_t batchId = m_inFlight.front().batchId;
+            lock.unlock();
+            std::cerr << std::format("Replication batch {} to server {}:{} wasn't acked in time", batchId, m_replica.ip, m_replica.port) << std::endl;
+            failConnection(connection);
+            continue;
+        }
+        if (!canSend) {
+            std::vector<Callback> expiredCallbacks = takeExpiredPuts(getCurrentTimeMs());
+            lock.unlock();
+            for (auto& callback : expiredCallbacks) callback(false);
+            continue;
+        }
+        // Nagle-style: while earlier batches are unacked, give the batch a moment to fill up
+        if (!m_inFlight.empty()) {
+            m_cv.wait_until(lock, m_pending.front().enqueuedAt + MAX_REPLICATION_BATCH_DELAY, [this, &stoken](){
+                return stoken.stop_requested() || isBatchFull();
+            });
+            if (stoken.stop_requested()) break;
+        }
+
+        dkvs::ClientMessage message;
+        message.set_priority(dkvs::Priority::REPLICATION);
+        dkvs::ReplicateRequest* batch = message.mutable_replicate();
+        std::vector<Callback> callbacks;
+        std::vector<Callback> expiredCallbacks;
+        std::optional<uint64_t> batchDeadlineMs{0};
+        uint64_t now = getCurrentTimeMs();
+        size_t batchBytes{0};
+        while (!m_pending.empty() && callbacks.size() < MAX_REPLICATION_BATCH_PUTS && batchBytes < MAX_REPLICATION_BATCH_BYTES) {
+            PendingPut& pending = m_pending.front();
+            size_t putBytes = pending.request.ByteSizeLong();
+            m_pendingBytes -= putBytes;
+            if (pending.deadlineMs && *pending.deadlineMs <= now) {
+                expiredCallbacks.push_back(std::move(pending.callback));
+                m_pending.pop_front();
+                continue;
+            }
+            // the batch may wait until its most patient put gives up
+            if (!pending.deadlineMs) batchDeadlineMs.reset();
+            else if (batchDeadlineMs) batchDeadlineMs = std::max(*batchDeadlineMs, *pending.deadlineMs);
+            batchBytes += putBytes;
+            *batch->add_puts() = std::move(pending.request);
+            callbacks.push_back(std::move(pending.callback));
+            m_pending.pop_front();
+        }
+        if (callbacks.empty()) {
+            lock.unlock();
+            for (auto& callback : expiredCallbacks) callback(false);
+            continue;
+        }
+        uint64_t batchId = m_nextBatchId++;
+        batch->set_batch_id(batchId);
+        if (batchDeadlineMs) message.set_deadline_ms(*batchDeadlineMs);
+
+        std::shared_ptr<Connection> connection = m_connection;
+        bool inBackoff = !connection && std::chrono::steady_clock::now() < m_reconnectAfter;
+        lock.unlock();
+        for (auto& callback : expiredCallbacks) callback(false);
+
+        if (inBackoff) {
+            for (auto& callback : callbacks) callback(false);
+            continue;
+        }
+        if (!connection) {
+            try {
+                connection = connect();
+            } catch (std::runtime_error& e) {
+                std::cerr << std::format("Failed to open replication stream: {}", e.what()) << std::endl;
+                lock.lock();
+                m_reconnectAfter = std::chrono::steady_clock::now() + REPLICATION_RECONNECT_BACKOFF;
+                lock.unlock();
+                for (auto& callback : callbacks) callback(false);
+                continue;
+            }
+            lock.lock();
+            m_connection = connection;
+            m_cv.notify_all();
+            lock.unlock();
+        }
+
+        // register before sending so the ack can never beat us to it
+        lock.lock();
+        if (m_connection != connection) {
+            lock.unlock();
+            for (auto& callback : callbacks) callback(false);
+            continue;
+        }
+        m_inFlight.push_back(InFlightBatch{.batchId{batchId}, .callbacks{std::move(callbacks)}, .sentAt{std::chrono::steady_clock::now()}});
+        lock.unlock();
+
+        try {
+            sendMessage(connection->socketfd, message.SerializeAsString());
+        } catch (std::runtime_error& e) {
+            std::cerr << std::format("Failed to send replication batch to server {}:{} -- {}", m_replica.ip, m_replica.port, e.what()) << std::endl;
+            failConnection(connection);
+        }
+    }
+}
+
+void ReplicationQueue::receiveAcks(std::stop_token stoken) {
+    while (!stoken.stop_requested()) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cv.wait(lock, [this, &stoken](){
+            return stoken.stop_requested() || m_connection;
+        });
+        if (stoken.stop_requested()) break;
+        std::shared_ptr<Connection> connection = m_connection;
+        lock.unlock();
+
+        try {
+            while (!stoken.stop_requested()) {
+                dkvs::ServerMessage serverMessage;
+                if (!serverMessage.ParseFromString(getMessage(connection->socketfd)))
+                    throw std::runtime_error("Failed to parse server message inside of replication stream");
+                if (!serverMessage.has_replicate())
+                    throw std::runtime_error("Server response does not have a replicate response");
+                handleAck(connection, serverMessage.replicate());
+            }
+        } catch (std::runtime_error& e) {
+            if (!stoken.stop_requested())
+                std::cerr << std::format("Replication stream to server {}:{} failed: {}", m_replica.ip, m_replica.port, e.what()) << std::endl;
+            failConnection(connection);
+        }
+    }
+}
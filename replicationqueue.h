@@ -0,0 +1,88 @@
+#ifndef REPLICATIONQUEUE_H
+#define REPLICATIONQUEUE_H
+
+#include "nodes.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stop_token>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "./protobufs/generated/dkvs.pb.h"
+
+inline const size_t MAX_REPLICATION_BATCH_PUTS = 512;
+inline const size_t MAX_REPLICATION_BATCH_BYTES = 256 * 1024;
+inline const size_t MAX_REPLICATION_BATCHES_IN_FLIGHT = 16;
+inline const std::chrono::microseconds MAX_REPLICATION_BATCH_DELAY{500};
+inline const std::chrono::milliseconds REPLICATION_RECONNECT_BACKOFF{200};
+// a replica that holds the oldest batch unacked (or stops reading) this long is treated as down
+inline const std::chrono::milliseconds REPLICATION_ACK_TIMEOUT{5000};
+// puts beyond this fail right away instead of piling up behind a slow replica
+inline const size_t MAX_REPLICATION_PENDING_PUTS = MAX_REPLICATION_BATCH_PUTS * MAX_REPLICATION_BATCHES_IN_FLIGHT;
+// how often the sender wakes up to check ack timeouts and drop expired puts while it waits
+inline const std::chrono::milliseconds REPLICATION_SWEEP_INTERVAL{50};
+
+// Streams puts from a primary to a single replica. Puts are coalesced into batches
+// and pipelined over one persistent connection; the replica acks each batch in order.
+class ReplicationQueue {
+public:
+    using Callback = std::function<void(bool success)>;
+
+private:
+    struct Connection {
+        int socketfd;
+        ~Connection();
+    };
+
+    struct PendingPut {
+        dkvs::PutRequest request;
+        Callback callback;
+        std::optional<uint64_t> deadlineMs;
+        std::chrono::steady_clock::time_point enqueuedAt;
+    };
+
+    struct InFlightBatch {
+        uint64_t batchId;
+        std::vector<Callback> callbacks;
+        std::chrono::steady_clock::time_point sentAt;
+    };
+
+    Node m_replica;
+    short m_primaryPort;
+    std::deque<PendingPut> m_pending;
+    size_t m_pendingBytes{0};
+    std::deque<InFlightBatch> m_inFlight;
+    uint64_t m_nextBatchId{1};
+    std::shared_ptr<Connection> m_connection;
+    std::chrono::steady_clock::time_point m_reconnectAfter{};
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::stop_source m_stopSource;
+    std::jthread m_sender;
+    std::jthread m_receiver;
+
+    bool isBatchFull() const;
+    std::vector<Callback> takeExpiredPuts(uint64_t nowMs);
+    std::shared_ptr<Connection> connect();
+    void failConnection(const std::shared_ptr<Connection>& connection);
+    void handleAck(const std::shared_ptr<Connection>& connection, const dkvs::ReplicateResponse& response);
+    void sendBatches(std::stop_token stoken);
+    void receiveAcks(std::stop_token stoken);
+
+public:
+    ReplicationQueue(const Node& replica, short primaryPort);
+    ~ReplicationQueue();
+    ReplicationQueue(const ReplicationQueue&) = delete;
+    ReplicationQueue& operator=(const ReplicationQueue&) = delete;
+
+    // callback runs on a replication thread once the replica acks (or fails) the put;
+    // puts whose deadline passes before they are sent are dropped and fail, and puts that
+    // don't fit in the pending queue fail immediately on the calling thread
+    void enqueue(const dkvs::PutRequest& request, std::optional<uint64_t> deadlineMs, Callback callback);
+};
+#endif // REPLICATIONQUEUE_H
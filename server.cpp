@@ -2,17 +2,28 @@
 #include "nodes.h"
 #include "hashring.h"
 #include "threadpool.h"
+#include "replicationqueue.h"
+#include "compactstore.h"
 #include <type_traits>
 #include <iostream>
 #include <stdexcept>
 #include <vector>
 #include <future>
 #include <format>
-#include <unordered_map>
+#include <map>
+#include <list>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include <optional>
 #include <mutex>
 #include <thread>
 #include <sstream>
 #include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -20,150 +31,388 @@
 #include "./protobufs/generated/dkvs.pb.h"
 
 static const int MAX_SERVER_CONNECTION_QUEUE = 100;
+static const size_t MAX_INTAKE_CONNECTIONS = 1024;
+static const std::chrono::milliseconds MAX_INTAKE_TIME{5000};
+static const int INTAKE_POLL_INTERVAL_MS = 100;
+static const size_t INTAKE_READ_CHUNK_SIZE = 16 * 1024;
+static const std::chrono::milliseconds ACCEPT_ERROR_BACKOFF{100};
+static const size_t SERVER_THREADS = 8;
+static const size_t MAX_QUEUED_TASKS_PER_PRIORITY = 256;
+static const size_t MAX_SESSIONS = 256;
+// a peer that doesn't drain its receive window for this long loses its connection
+static const std::chrono::milliseconds MAX_SEND_TIME{1000};
 class Server {
-    struct StoreObject {
-        std::string value;
-        uint64_t timestamp;
+    // a persistent connection served by its own thread, either a replication stream or a client session
+    struct Stream {
+        int socketfd;
+        bool isSession;
+        std::jthread thread;
     };
+    struct Session {
+        int socketfd;
+        std::mutex writeMtx;
+        bool broken{false};
+
+        ~Session() {
+            cleanup(socketfd);
+        }
+
+        // Sends time out after MAX_SEND_TIME, so a client that stops reading can hold a worker
+        // for at most that long. The session is then dropped: later responses are discarded
+        // and the session thread's read fails.
+        void send(const dkvs::ServerMessage& serverMessage) {
+            std::unique_lock<std::mutex> lock(writeMtx);
+            if (broken) return;
+            try {
+                sendMessage(socketfd, serverMessage.SerializeAsString());
+            } catch (std::runtime_error& e) {
+                std::cerr << std::format("Failed to send session response, closing session: {}", e.what()) << std::endl;
+                broken = true;
+                shutdown(socketfd, SHUT_RDWR);
+            }
+        }
+    };
+    // an accepted connection whose first message hasn't fully arrived yet
+    struct IntakeConnection {
+        int socketfd;
+        std::string buffer;
+        std::chrono::steady_clock::time_point acceptedAt;
+    };
+    using Responder = std::function<void(dkvs::ServerMessage)>;
     HashRing m_hashRing;
     ThreadPool m_threadPool;
-    std::unordered_map<std::string, StoreObject> m_store;
+    CompactStore m_store;
     std::mutex m_storeAndTimestampMtx;
     uint64_t m_timestamp{1};
     int m_serverSocketfd;
     short m_serverPort;
+    std::map<Node, std::unique_ptr<ReplicationQueue>> m_replicationQueues;
+    std::list<Stream> m_streams;
+    std::mutex m_streamsMtx;
 
     dkvs::GetResponse get(const dkvs::GetRequest& request) {
         const std::string& key = request.key();
         std::unique_lock<std::mutex> lock(m_storeAndTimestampMtx);
         dkvs::GetResponse response;
-        if(!m_store.count(key)) response.set_found(false);
+        std::optional<StoreEntryView> entry = m_store.get(key);
+        if (!entry) response.set_found(false);
         else {
             response.set_found(true);
-            response.set_value(m_store[key].value);
-            response.set_timestamp(m_store[key].timestamp);
+            response.set_value(std::string(entry->value));
+            response.set_timestamp(entry->timestamp);
         }
         std::cout<<std::format("server is responding with {}", response.DebugString())<<std::endl;
         return response;
     }
 
-    dkvs::PutResponse tryReplicatePut(const dkvs::PutRequest& request) {
+    dkvs::ServerMessage tryReplicatePut(const dkvs::PutRequest& request, std::optional<uint64_t> deadlineMs) {
         std::vector<Node> replicas = m_hashRing.getNodesForKey(request.key());
+        dkvs::ServerMessage serverMessage;
+        serverMessage.set_status(dkvs::Status::OK);
         // first replica is the primary node that is responible for replicating
         if (replicas[0].port != m_serverPort) {
-            dkvs::PutResponse response;
-            response.set_success(true);
-            return response;
+            serverMessage.mutable_put()->set_success(true);
+            return serverMessage;
         }
         size_t timeout{30};
         size_t numServersReplicateTo = replicas.size();
         size_t thresholdForCompletion = m_hashRing.getNumNodes()/2 + 1;
 
-        std::vector<std::future<void>> futureVals;
-        futureVals.reserve(numServersReplicateTo-1);
-
-        dkvs::ClientMessage message;
-        *message.mutable_put() = request;  
-
-        std::atomic<size_t> responses{1}; // includes primary
-        std::mutex mtx;
-        std::condition_variable cv;
+        // shared with the replication callbacks, which may outlive this call on timeout
+        struct Quorum {
+            std::mutex mtx;
+            std::condition_variable cv;
+            size_t responses{1}; // includes primary
+            size_t failures{0};
+        };
+        auto quorum = std::make_shared<Quorum>();
         for (size_t i = 1; i < numServersReplicateTo; i++) {
-            futureVals.emplace_back(std::async(std::launch::async, [this, &message, &replicas, i, &responses, &cv](){
-                Node& server = replicas[i];
-                sockaddr_in socketAddress = getSocketAddress(server);
-                int socketfd = getSocketFd();
-                if (connect(socketfd, (const sockaddr*)&socketAddress, sizeof(struct sockaddr_in)) == -1) {
-                    cleanup(socketfd);
-                    throw std::runtime_error(std::format("Couldn't connect client socket to server {}:{} -- {}", server.ip, server.port, std::string(strerror(errno))));
-                }        
-                try {
-                    sendMessage(socketfd, message.SerializeAsString());
-                } catch (std::runtime_error& e) {
-                    cleanup(socketfd);
-                    throw std::runtime_error(std::format("Failed to send message: {}", e.what()));
-                }
-                dkvs::PutResponse putResponse; 
-                std::string serverResponse = getMessage(socketfd);
-                dkvs::ServerMessage serverMessage;
-                if (!serverMessage.ParseFromString(serverResponse))
-                    throw std::runtime_error("Failed to parse server message inside of replicate put");
-                if (!serverMessage.has_put())
-                    throw std::runtime_error("Server response does not have a put response");
-                if (!serverMessage.put().success())
-                    return;
-                std::cout << std::format("server on port {} replicated to server on port {} successfully", m_serverPort, server.port) << std::endl;
-                responses.fetch_add(1, std::memory_order_relaxed);
-                cv.notify_one();
-            }));
-        }
-        std::unique_lock<std::mutex> lock(mtx);
-        bool noTimeout = cv.wait_for(lock, std::chrono::seconds(timeout), [&responses, &thresholdForCompletion](){
-            return responses.load(std::memory_order::relaxed) >= thresholdForCompletion;
+            m_replicationQueues.at(replicas[i])->enqueue(request, deadlineMs, [quorum](bool success){
+                std::unique_lock<std::mutex> lock(quorum->mtx);
+                if (success) quorum->responses++;
+                else quorum->failures++;
+                quorum->cv.notify_one();
+            });
+        }
+        auto waitUntil = std::chrono::system_clock::now() + std::chrono::seconds(timeout);
+        if (deadlineMs) waitUntil = std::chrono::system_clock::time_point{std::chrono::milliseconds{*deadlineMs}};
+        std::unique_lock<std::mutex> lock(quorum->mtx);
+        // stop waiting as soon as the quorum is reached, or can no longer be reached because too many replicas failed
+        quorum->cv.wait_until(lock, waitUntil, [&quorum, &thresholdForCompletion, &numServersReplicateTo](){
+            size_t outstanding = numServersReplicateTo - quorum->responses - quorum->failures;
+            return quorum->responses >= thresholdForCompletion || quorum->responses + outstanding < thresholdForCompletion;
         });
+        bool reachedQuorum = quorum->responses >= thresholdForCompletion;
 
-        std::cout << std::format("Replicated to {} nodes and timeout was {}", responses.load(std::memory_order_relaxed), timeout?"true":"false") << std::endl;
-        dkvs::PutResponse response;
-        response.set_success(noTimeout);
-        return response;
+        std::cout << std::format("Replicated to {} nodes, {} failed and quorum was {}", quorum->responses, quorum->failures, reachedQuorum?"reached":"not reached") << std::endl;
+        serverMessage.mutable_put()->set_success(reachedQuorum);
+        if (!reachedQuorum) {
+            serverMessage.set_status(dkvs::Status::ERROR);
+            serverMessage.set_error_message(std::format("Replicated to {} of {} nodes ({} failed, {} still pending), needed {}", quorum->responses, numServersReplicateTo,
+                quorum->failures, numServersReplicateTo - quorum->responses - quorum->failures, thresholdForCompletion));
+        }
+        return serverMessage;
     }
 
-    dkvs::PutResponse put(const dkvs::PutRequest& request) {
-        dkvs::PutRequest forwardedRequest(request);
-        std::unique_lock<std::mutex> lock(m_storeAndTimestampMtx);
+    // caller must hold m_storeAndTimestampMtx
+    uint64_t applyPut(const dkvs::PutRequest& request) {
         if (request.has_timestamp())m_timestamp = std::max(m_timestamp, request.timestamp());
         else m_timestamp++;
-        forwardedRequest.set_timestamp(m_timestamp);
-        m_store[request.key()] = StoreObject{.value{request.value()}, .timestamp{m_timestamp}};
+        m_store.put(request.key(), request.value(), m_timestamp);
+        return m_timestamp;
+    }
+
+    dkvs::ServerMessage put(const dkvs::PutRequest& request, std::optional<uint64_t> deadlineMs) {
+        dkvs::PutRequest forwardedRequest(request);
+        std::unique_lock<std::mutex> lock(m_storeAndTimestampMtx);
+        forwardedRequest.set_timestamp(applyPut(request));
+        lock.unlock();
+        dkvs::ServerMessage response = tryReplicatePut(forwardedRequest, deadlineMs);
+        return response;
+    }
+
+    dkvs::StatsResponse stats() {
+        std::unique_lock<std::mutex> lock(m_storeAndTimestampMtx);
+        StoreMemoryStats memoryStats = m_store.getMemoryStats();
         lock.unlock();
-        dkvs::PutResponse response = tryReplicatePut(forwardedRequest);
+        dkvs::StatsResponse response;
+        response.set_num_entries(memoryStats.numEntries);
+        response.set_payload_bytes(memoryStats.payloadBytes);
+        response.set_entry_bytes(memoryStats.entryBytes);
+        response.set_table_bytes(memoryStats.tableBytes);
+        response.set_reserved_bytes(memoryStats.reservedBytes);
         return response;
     }
 
-    void handleConnection(int connectedfd) {
-        std::string message;
+    dkvs::ReplicateResponse replicate(const dkvs::ReplicateRequest& request) {
+        dkvs::ReplicateResponse response;
+        response.set_batch_id(request.batch_id());
+        std::unique_lock<std::mutex> lock(m_storeAndTimestampMtx);
+        uint64_t appliedTimestamp{0};
+        for (const auto& put : request.puts())
+            appliedTimestamp = std::max(appliedTimestamp, applyPut(put));
+        lock.unlock();
+        response.set_success(true);
+        response.set_applied_timestamp(appliedTimestamp);
+        return response;
+    }
+
+    // Serves a primary's persistent replication connection until it closes. Batches are
+    // applied and acked in the order they arrive.
+    void handleReplicationStream(int connectedfd, dkvs::ClientMessage clientMessage) {
         try {
-            message = getMessage(connectedfd);
+            while (true) {
+                dkvs::ServerMessage serverMessage;
+                if (isExpired(clientMessage)) {
+                    // the primary already gave up on these puts, don't spend time applying them
+                    serverMessage = getOverloadedMessage("Replication batch deadline passed before it was applied");
+                    serverMessage.mutable_replicate()->set_batch_id(clientMessage.replicate().batch_id());
+                    serverMessage.mutable_replicate()->set_success(false);
+                } else {
+                    serverMessage.set_status(dkvs::Status::OK);
+                    *serverMessage.mutable_replicate() = replicate(clientMessage.replicate());
+                }
+                sendMessage(connectedfd, serverMessage.SerializeAsString());
+
+                if (!clientMessage.ParseFromString(getMessage(connectedfd)))
+                    throw std::runtime_error("Failed to parse message as ClientMessage");
+                if (!clientMessage.has_replicate())
+                    throw std::runtime_error("Replication stream message does not have a replicate request");
+            }
         } catch (std::runtime_error& e) {
-            std::cerr << std::format("Failed to get message: {}", e.what()) << std::endl;
-            cleanup(connectedfd);
+            std::cerr << std::format("Replication stream closed: {}", e.what()) << std::endl;
+        }
+
+        releaseStream(connectedfd);
+        cleanup(connectedfd);
+    }
+
+    // Serves a client's persistent connection until it closes. Requests are admitted like
+    // one-shot requests, so they run concurrently and their responses, tagged with the
+    // request_id, may come back out of order.
+    void handleSession(int connectedfd, dkvs::ClientMessage clientMessage) {
+        auto session = std::make_shared<Session>(connectedfd);
+        try {
+            while (true) {
+                uint64_t requestId = clientMessage.request_id();
+                admitRequest(std::move(clientMessage), [session, requestId](dkvs::ServerMessage serverMessage){
+                    serverMessage.set_request_id(requestId);
+                    session->send(serverMessage);
+                });
+
+                clientMessage = dkvs::ClientMessage{};
+                if (!clientMessage.ParseFromString(getMessage(connectedfd)))
+                    throw std::runtime_error("Failed to parse message as ClientMessage");
+            }
+        } catch (std::runtime_error& e) {
+            std::cerr << std::format("Session closed: {}", e.what()) << std::endl;
+        }
+
+        // queued requests still hold the session, the last one out closes the socket
+        releaseStream(connectedfd);
+    }
+
+    // called once a stream stops reading, after this ~Server no longer needs to unblock it
+    void releaseStream(int connectedfd) {
+        std::unique_lock<std::mutex> lock(m_streamsMtx);
+        for (auto& stream : m_streams)
+            if (stream.socketfd == connectedfd) stream.socketfd = -1;
+    }
+
+    // Streams are long lived, so they get their own thread instead of holding a pool worker.
+    // Replication streams are bounded by the number of nodes, client sessions by MAX_SESSIONS,
+    // past which new sessions are shed with OVERLOADED.
+    void startStream(int connectedfd, dkvs::ClientMessage clientMessage) {
+        bool isSession = !clientMessage.has_replicate();
+        std::unique_lock<std::mutex> lock(m_streamsMtx);
+        m_streams.remove_if([](const Stream& stream){ return stream.socketfd == -1; });
+        if (isSession && std::ranges::count_if(m_streams, [](const Stream& stream){ return stream.isSession; }) >= static_cast<std::ptrdiff_t>(MAX_SESSIONS)) {
+            lock.unlock();
+            dkvs::ServerMessage serverMessage = getOverloadedMessage("Server has too many open sessions");
+            serverMessage.set_request_id(clientMessage.request_id());
+            sendResponse(connectedfd, serverMessage);
             return;
         }
-        
+        // the thread can't release its entry before it's added since we hold m_streamsMtx, and
+        // if it can't be created nothing is left behind pointing at the fd
+        std::jthread thread([this, connectedfd, clientMessage = std::move(clientMessage)]() mutable {
+            if (clientMessage.has_replicate())
+                handleReplicationStream(connectedfd, std::move(clientMessage));
+            else
+                handleSession(connectedfd, std::move(clientMessage));
+        });
+        m_streams.push_back(Stream{.socketfd{connectedfd}, .isSession{isSession}, .thread{std::move(thread)}});
+    }
+
+    static bool isExpired(const dkvs::ClientMessage& clientMessage) {
+        return clientMessage.has_deadline_ms() && clientMessage.deadline_ms() <= getCurrentTimeMs();
+    }
+
+    static dkvs::ServerMessage getOverloadedMessage(const std::string& reason) {
         dkvs::ServerMessage serverMessage;
-        serverMessage.set_status(dkvs::Status::OK);
-        dkvs::ClientMessage clientMessage;
-        if (!clientMessage.ParseFromString(message)) {
-            serverMessage.set_status(dkvs::Status::INVALID);
-            serverMessage.set_error_message(std::format("Failed to parse message as ClientMessage {}", message));
-        } else {
-            std::cout << std::format("Recieved \"{}\" from client", clientMessage.DebugString()) << std::endl;
-            if (clientMessage.has_get())
-                *serverMessage.mutable_get() = get(clientMessage.get());
-            else if (clientMessage.has_put())
-                *serverMessage.mutable_put() = put(clientMessage.put());
-            else {
-                serverMessage.set_status(dkvs::Status::INVALID);
-                serverMessage.set_error_message(std::format("Message does not have a get or put request {}",message));
-            }
+        serverMessage.set_status(dkvs::Status::OVERLOADED);
+        serverMessage.set_error_message(reason);
+        return serverMessage;
+    }
+
+    // Replication batches don't go through the pool at all: each replication stream applies
+    // its batches on its own thread, and the primary never has more than
+    // MAX_REPLICATION_BATCHES_IN_FLIGHT of them outstanding, so they are exempt from admission
+    // control by design. The priority is set by the client, so a GET or PUT that claims to be
+    // REPLICATION is just client work and can't use it to jump ahead of everyone else.
+    static TaskPriority getTaskPriority(dkvs::Priority priority) {
+        switch (priority) {
+            case dkvs::Priority::READ_REPAIR: return TaskPriority::Low;
+            default: return TaskPriority::Normal;
         }
+    }
 
+    void sendResponse(int connectedfd, const dkvs::ServerMessage& serverMessage) {
         try {
             sendMessage(connectedfd, serverMessage.SerializeAsString());
         } catch (std::runtime_error& e) {
             std::cerr << std::format("Failed to send response: {}", e.what()) << std::endl;
-            cleanup(connectedfd);
+        }
+        cleanup(connectedfd);
+    }
+
+    dkvs::ServerMessage handleRequest(const dkvs::ClientMessage& clientMessage) {
+        std::cout << std::format("Recieved \"{}\" from client", clientMessage.DebugString()) << std::endl;
+        if (isExpired(clientMessage))
+            return getOverloadedMessage("Request deadline passed while it was queued");
+
+        dkvs::ServerMessage serverMessage;
+        serverMessage.set_status(dkvs::Status::OK);
+        std::optional<uint64_t> deadlineMs;
+        if (clientMessage.has_deadline_ms()) deadlineMs = clientMessage.deadline_ms();
+        if (clientMessage.has_get())
+            *serverMessage.mutable_get() = get(clientMessage.get());
+        else if (clientMessage.has_put())
+            serverMessage = put(clientMessage.put(), deadlineMs);
+        else
+            *serverMessage.mutable_stats() = stats();
+        return serverMessage;
+    }
+
+    // Queues the real work at the request's priority. Requests that are invalid, already
+    // expired or don't fit in their queue are answered right away.
+    void admitRequest(dkvs::ClientMessage clientMessage, Responder respond) {
+        if (!clientMessage.has_get() && !clientMessage.has_put() && !clientMessage.has_stats()) {
+            dkvs::ServerMessage serverMessage;
+            serverMessage.set_status(dkvs::Status::INVALID);
+            serverMessage.set_error_message(std::format("Message does not have a get, put or stats request {}", clientMessage.DebugString()));
+            respond(std::move(serverMessage));
+            return;
+        }
+        if (isExpired(clientMessage)) {
+            respond(getOverloadedMessage("Request deadline passed before it was read"));
             return;
         }
 
-        cleanup(connectedfd);
+        TaskPriority priority = getTaskPriority(clientMessage.priority());
+        auto request = std::make_shared<dkvs::ClientMessage>(std::move(clientMessage));
+        bool queued = m_threadPool.addTask([this, request, respond](){
+            respond(handleRequest(*request));
+        }, priority);
+        if (!queued)
+            respond(getOverloadedMessage("Server request queue is full"));
+    }
+
+    // Reads whatever part of the first message has arrived without blocking, and never past
+    // its end since a session may already have sent more. Returns the message once it's
+    // complete, throws if the connection fails first or the message is too large. The buffer
+    // only grows as bytes arrive, so a length prefix alone can't make us allocate anything.
+    static std::optional<std::string> readFirstMessage(IntakeConnection& connection) {
+        char chunk[INTAKE_READ_CHUNK_SIZE];
+        while (true) {
+            size_t wanted = sizeof(uint32_t);
+            if (connection.buffer.size() >= sizeof(uint32_t)) {
+                uint32_t len_n;
+                std::memcpy(&len_n, connection.buffer.data(), sizeof(len_n));
+                uint32_t len = ntohl(len_n);
+                if (len > MAX_MESSAGE_SIZE)
+                    throw std::runtime_error(std::format("First message of {} bytes is larger than the {} byte limit", len, MAX_MESSAGE_SIZE));
+                wanted += len;
+                if (connection.buffer.size() == wanted) return connection.buffer.substr(sizeof(uint32_t));
+            }
+            ssize_t bytesRead = recv(connection.socketfd, chunk, std::min(wanted - connection.buffer.size(), sizeof(chunk)), MSG_DONTWAIT);
+            if (bytesRead > 0) connection.buffer.append(chunk, static_cast<size_t>(bytesRead));
+            if (bytesRead == 0)
+                throw std::runtime_error("Connection closed before its first message arrived");
+            if (bytesRead == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return std::nullopt;
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::format("Failed to read first message: {}", std::string(strerror(errno))));
+            }
+        }
+    }
+
+    // Handles the first message on a connection. Replication streams and client sessions
+    // (messages with a request_id) keep the connection open, anything else is a one-shot request.
+    void handleConnection(int connectedfd, const std::string& message) {
+        dkvs::ClientMessage clientMessage;
+        if (!clientMessage.ParseFromString(message)) {
+            dkvs::ServerMessage serverMessage;
+            serverMessage.set_status(dkvs::Status::INVALID);
+            serverMessage.set_error_message(std::format("Failed to parse message as ClientMessage {}", message));
+            sendResponse(connectedfd, serverMessage);
+            return;
+        }
+        if (clientMessage.has_replicate() || clientMessage.has_request_id()) {
+            startStream(connectedfd, std::move(clientMessage));
+            return;
+        }
+        admitRequest(std::move(clientMessage), [this, connectedfd](dkvs::ServerMessage serverMessage){
+            sendResponse(connectedfd, serverMessage);
+        });
     }
 
 public:
     Server(short port) : 
     m_serverPort{port},
     m_serverSocketfd{socket(AF_INET, SOCK_STREAM, 0)},
-    m_hashRing{nodes}
+    m_hashRing{nodes},
+    m_threadPool{SERVER_THREADS, MAX_QUEUED_TASKS_PER_PRIORITY}
     {
         if (m_serverSocketfd == -1) {
             throw std::runtime_error(std::format("Couldn't create server socket: {}", std::string(strerror(errno))));
@@ -189,28 +438,107 @@ public:
             throw std::runtime_error(std::format("Couldn't listen server socket: {}", std::string(strerror(errno))));
         }
 
+        // start() drains the backlog until accept would block, accepted sockets stay blocking
+        if (fcntl(m_serverSocketfd, F_SETFL, fcntl(m_serverSocketfd, F_GETFL) | O_NONBLOCK) == -1) {
+            cleanup(m_serverSocketfd);
+            throw std::runtime_error(std::format("Couldn't make server socket non blocking: {}", std::string(strerror(errno))));
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+        for (const auto& node : nodes)
+            if (node.port != m_serverPort)
+                m_replicationQueues.emplace(node, std::make_unique<ReplicationQueue>(node, m_serverPort));
+
         std::cout << std::format("Server is listening on port {}", port) << std::endl;
     }
 
     ~Server() {
         m_threadPool.stop();
+        m_replicationQueues.clear();
+        std::unique_lock<std::mutex> lock(m_streamsMtx);
+        for (auto& stream : m_streams)
+            if (stream.socketfd != -1) shutdown(stream.socketfd, SHUT_RDWR);
+        std::list<Stream> streams;
+        streams.swap(m_streams);
+        lock.unlock();
+        streams.clear();
         if (m_serverSocketfd != -1) cleanup(m_serverSocketfd);
     }
 
+    // Accepts connections and reads their first message on this thread, so intake never costs
+    // a pool worker: one-shot requests are queued (or shed with OVERLOADED) at their own
+    // priority, and replication streams and sessions go straight to their own thread instead of
+    // waiting behind client work.
     void start() {
-        sockaddr_in connectedAddress{};
-        socklen_t connectedAddressLength;
-        int connectedfd;
-        while ((connectedfd = accept(m_serverSocketfd, (sockaddr*)&connectedAddress, &connectedAddressLength)) != -1) {
-            char clientIp[1024];
-            inet_ntop(AF_INET, (const void*)&connectedAddress.sin_addr, clientIp, sizeof(clientIp));
-            std::cout << "Accepted connection from " 
-                    << clientIp
-                    << ":" << ntohs(connectedAddress.sin_port) 
-                    << std::endl;
-            m_threadPool.addTask([this, connectedfd] { 
-                handleConnection(connectedfd);
-             });
+        std::vector<IntakeConnection> intakeConnections;
+        std::vector<pollfd> pollfds;
+        std::chrono::steady_clock::time_point acceptPausedUntil{};
+        while (true) {
+            pollfds.clear();
+            // stop accepting while intake is full or accept is failing, the listen backlog holds the rest
+            bool acceptingConnections = intakeConnections.size() < MAX_INTAKE_CONNECTIONS && std::chrono::steady_clock::now() >= acceptPausedUntil;
+            if (acceptingConnections)
+                pollfds.push_back(pollfd{.fd{m_serverSocketfd}, .events{POLLIN}});
+            for (const auto& connection : intakeConnections)
+                pollfds.push_back(pollfd{.fd{connection.socketfd}, .events{POLLIN}});
+            if (poll(pollfds.data(), pollfds.size(), INTAKE_POLL_INTERVAL_MS) == -1) {
+                if (errno == EINTR) continue;
+                std::cerr << std::format("Failed to poll connections: {}", std::string(strerror(errno))) << std::endl;
+                return;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            const pollfd* intakePollfds = pollfds.data() + (acceptingConnections ? 1 : 0);
+            std::vector<IntakeConnection> waitingConnections;
+            for (size_t i = 0; i < intakeConnections.size(); i++) {
+                IntakeConnection& connection = intakeConnections[i];
+                try {
+                    std::optional<std::string> message;
+                    if (intakePollfds[i].revents) message = readFirstMessage(connection);
+                    if (message) handleConnection(connection.socketfd, *message);
+                    else if (now - connection.acceptedAt >= MAX_INTAKE_TIME)
+                        throw std::runtime_error("Timed out waiting for the first message");
+                    else waitingConnections.push_back(std::move(connection));
+                } catch (std::exception& e) {
+                    // one bad connection, or a failure to start its stream, must never take down the accept loop
+                    std::cerr << std::format("Failed to get message: {}", e.what()) << std::endl;
+                    cleanup(connection.socketfd);
+                }
+            }
+            intakeConnections.swap(waitingConnections);
+
+            if (!acceptingConnections || !(pollfds[0].revents & POLLIN)) continue;
+            while (intakeConnections.size() < MAX_INTAKE_CONNECTIONS) {
+                sockaddr_in connectedAddress{};
+                socklen_t connectedAddressLength = sizeof(connectedAddress);
+                int connectedfd = accept(m_serverSocketfd, (sockaddr*)&connectedAddress, &connectedAddressLength);
+                if (connectedfd == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    // only a broken listen socket is fatal, running out of fds, buffers or memory
+                    // is what overload looks like and passes once connections close
+                    if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK) {
+                        std::cerr << std::format("Failed to accept connection: {}", std::string(strerror(errno))) << std::endl;
+                        return;
+                    }
+                    std::cerr << std::format("Failed to accept connection, pausing accept for {}ms: {}", ACCEPT_ERROR_BACKOFF.count(), std::string(strerror(errno))) << std::endl;
+                    acceptPausedUntil = std::chrono::steady_clock::now() + ACCEPT_ERROR_BACKOFF;
+                    break;
+                }
+                char clientIp[1024];
+                inet_ntop(AF_INET, (const void*)&connectedAddress.sin_addr, clientIp, sizeof(clientIp));
+                std::cout << "Accepted connection from " 
+                        << clientIp
+                        << ":" << ntohs(connectedAddress.sin_port) 
+                        << std::endl;
+                timeval sendTimeout{.tv_sec{MAX_SEND_TIME.count() / 1000}, .tv_usec{(MAX_SEND_TIME.count() % 1000) * 1000}};
+                if (setsockopt(connectedfd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout)) == -1) {
+                    std::cerr << std::format("setsockopt failed: {}", std::string(strerror(errno))) << std::endl;
+                    cleanup(connectedfd);
+                    continue;
+                }
+                intakeConnections.push_back(IntakeConnection{.socketfd{connectedfd}, .acceptedAt{now}});
+            }
         }
     }
 
@@ -0,0 +1,80 @@
+#include "slaballocator.h"
+#include <algorithm>
+#include <new>
+
+SlabAllocator::SlabAllocator() {
+    for (size_t blockSize = SLAB_ALIGNMENT; blockSize <= MAX_SLAB_BLOCK_SIZE;) {
+        m_sizeClasses.push_back(SizeClass{.blockSize{blockSize}});
+        size_t step = blockSize < 128 ? SLAB_ALIGNMENT : blockSize / 4;
+        blockSize = (blockSize + step + SLAB_ALIGNMENT - 1) / SLAB_ALIGNMENT * SLAB_ALIGNMENT;
+    }
+}
+
+size_t SlabAllocator::getSizeClassIdx(size_t size) const {
+    auto it = std::lower_bound(m_sizeClasses.begin(), m_sizeClasses.end(), size, [](const SizeClass& sizeClass, size_t size){
+        return sizeClass.blockSize < size;
+    });
+    return static_cast<size_t>(it - m_sizeClasses.begin());
+}
+
+size_t SlabAllocator::getBlockSize(size_t size) const {
+    size_t idx = getSizeClassIdx(size);
+    if (idx == m_sizeClasses.size()) return size;
+    return m_sizeClasses[idx].blockSize;
+}
+
+BlockRef SlabAllocator::allocateLarge(size_t size) {
+    BlockRef idx;
+    if (!m_freeLargeBlocks.empty()) {
+        idx = m_freeLargeBlocks.back();
+        m_freeLargeBlocks.pop_back();
+    } else {
+        if (m_largeBlocks.size() >= LARGE_BLOCK_BIT - 1) throw std::bad_alloc();
+        idx = static_cast<BlockRef>(m_largeBlocks.size());
+        m_largeBlocks.emplace_back();
+    }
+    m_largeBlocks[idx] = std::make_unique_for_overwrite<std::byte[]>(size);
+    m_largeBytes += size;
+    m_allocatedBytes += size;
+    return idx | LARGE_BLOCK_BIT;
+}
+
+BlockRef SlabAllocator::allocate(size_t size) {
+    size_t idx = getSizeClassIdx(size);
+    if (idx == m_sizeClasses.size()) return allocateLarge(size);
+
+    SizeClass& sizeClass = m_sizeClasses[idx];
+    if (sizeClass.freeList != NULL_BLOCK_REF) {
+        BlockRef ref = sizeClass.freeList;
+        sizeClass.freeList = reinterpret_cast<FreeBlock*>(getBlock(ref))->next;
+        m_allocatedBytes += sizeClass.blockSize;
+        return ref;
+    }
+    if (sizeClass.bumpRef == sizeClass.bumpEnd) {
+        if (m_slabs.size() >= MAX_SLABS) throw std::bad_alloc();
+        BlockRef slabRef = static_cast<BlockRef>(m_slabs.size()) << OFFSET_BITS;
+        m_slabs.push_back(std::make_unique_for_overwrite<std::byte[]>(SLAB_SIZE));
+        sizeClass.bumpRef = slabRef;
+        sizeClass.bumpEnd = slabRef + static_cast<BlockRef>(SLAB_SIZE / sizeClass.blockSize * sizeClass.blockSize / SLAB_ALIGNMENT);
+    }
+    BlockRef ref = sizeClass.bumpRef;
+    sizeClass.bumpRef += static_cast<BlockRef>(sizeClass.blockSize / SLAB_ALIGNMENT);
+    m_allocatedBytes += sizeClass.blockSize;
+    return ref;
+}
+
+void SlabAllocator::deallocate(BlockRef ref, size_t size) {
+    if (ref & LARGE_BLOCK_BIT) {
+        BlockRef idx = ref & ~LARGE_BLOCK_BIT;
+        m_largeBlocks[idx].reset();
+        m_freeLargeBlocks.push_back(idx);
+        m_largeBytes -= size;
+        m_allocatedBytes -= size;
+        return;
+    }
+
+    SizeClass& sizeClass = m_sizeClasses[getSizeClassIdx(size)];
+    m_allocatedBytes -= sizeClass.blockSize;
+    new (getBlock(ref)) FreeBlock{sizeClass.freeList};
+    sizeClass.freeList = ref;
+}
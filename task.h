@@ -0,0 +1,179 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <format>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class Task;
+
+namespace detail {
+    template <typename T>
+    struct TaskPromiseBase {
+        std::coroutine_handle<> continuation{std::noop_coroutine()};
+        std::exception_ptr exception;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {return false;}
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                return handle.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept {return {};}
+        FinalAwaiter final_suspend() noexcept {return {};}
+        void unhandled_exception() {exception = std::current_exception();}
+    };
+
+    template <typename T>
+    struct TaskPromise : TaskPromiseBase<T> {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+        void return_value(T result) {value.emplace(std::move(result));}
+        T getResult() {
+            if (this->exception) std::rethrow_exception(this->exception);
+            return std::move(*value);
+        }
+    };
+
+    template <>
+    struct TaskPromise<void> : TaskPromiseBase<void> {
+        Task<void> get_return_object();
+        void return_void() {}
+        void getResult() {
+            if (exception) std::rethrow_exception(exception);
+        }
+    };
+}
+
+// Lazily started coroutine that resumes whoever co_awaits it once it finishes.
+template <typename T = void>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+public:
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle{handle} {}
+    Task(Task&& other) noexcept : m_handle{std::exchange(other.m_handle, {})} {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (m_handle) m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept {return !m_handle || m_handle.done();}
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        m_handle.promise().continuation = continuation;
+        return m_handle;
+    }
+    T await_resume() {return m_handle.promise().getResult();}
+};
+
+namespace detail {
+    template <typename T>
+    Task<T> TaskPromise<T>::get_return_object() {
+        return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+    }
+
+    inline Task<void> TaskPromise<void>::get_return_object() {
+        return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+    }
+
+    // Starts eagerly and frees itself when done, nobody awaits it
+    struct DetachedTask {
+        struct promise_type {
+            DetachedTask get_return_object() noexcept {return {};}
+            std::suspend_never initial_suspend() noexcept {return {};}
+            std::suspend_never final_suspend() noexcept {return {};}
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept {
+                try {
+                    throw;
+                } catch (std::exception& e) {
+                    std::cerr << std::format("Detached task failed: {}", e.what()) << std::endl;
+                } catch (...) {
+                    std::cerr << "Detached task failed with an unknown exception" << std::endl;
+                }
+            }
+        };
+    };
+
+    inline DetachedTask runDetached(Task<void> task) {
+        co_await task;
+    }
+}
+
+// Runs task until its first suspension and lets it finish in the background
+inline void spawn(Task<void> task) {
+    detail::runDetached(std::move(task));
+}
+
+// Single threaded one shot event: one coroutine waits, and is resumed inline by set().
+class CompletionEvent {
+    bool m_isSet{false};
+    std::coroutine_handle<> m_waiter;
+
+public:
+    void set() {
+        m_isSet = true;
+        if (m_waiter) std::exchange(m_waiter, {}).resume();
+    }
+
+    bool await_ready() const noexcept {return m_isSet;}
+    void await_suspend(std::coroutine_handle<> waiter) noexcept {m_waiter = waiter;}
+    void await_resume() const noexcept {}
+};
+
+// Runs all tasks concurrently on the current thread and returns their results in order.
+// If any task throws, the first exception is rethrown once every task has finished.
+template <typename T>
+Task<std::vector<T>> whenAll(std::vector<Task<T>> tasks) {
+    struct State {
+        std::vector<std::optional<T>> results;
+        size_t remaining;
+        std::exception_ptr exception;
+        CompletionEvent done;
+    };
+    auto state = std::make_shared<State>();
+    state->results.resize(tasks.size());
+    state->remaining = tasks.size();
+    if (tasks.empty()) co_return std::vector<T>{};
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        spawn([](std::shared_ptr<State> state, Task<T> task, size_t i) -> Task<void> {
+            try {
+                state->results[i].emplace(co_await task);
+            } catch (...) {
+                if (!state->exception) state->exception = std::current_exception();
+            }
+            if (--state->remaining == 0) state->done.set();
+        }(state, std::move(tasks[i]), i));
+    }
+    co_await state->done;
+    if (state->exception) std::rethrow_exception(state->exception);
+
+    std::vector<T> results;
+    results.reserve(state->results.size());
+    for (auto& result : state->results) results.push_back(std::move(*result));
+    co_return results;
+}
+#endif // TASK_H
@@ -1,17 +1,19 @@
 #include "threadpool.h"
 #include <iostream>
 #include <format>
+#include <algorithm>
 void ThreadPool::createThreadPool() {
     for (size_t i = 0; i < m_numThreads; i++) {
         m_threads.emplace_back([this](std::stop_token stoken){
             while (!stoken.stop_requested()) {
                 std::unique_lock<std::mutex> lock(m_tasksMtx);
                 m_tasksCv.wait(lock, [this, &stoken](){
-                    return stoken.stop_requested() || !m_tasks.empty();
+                    return stoken.stop_requested() || hasTasks();
                 });
-                if (m_tasks.empty()) break; // stop must have been requested otherwise we wouldn't exit cv loop
-                auto task = std::move(m_tasks.front());
-                m_tasks.pop_front();
+                if (!hasTasks()) break; // stop must have been requested otherwise we wouldn't exit cv loop
+                auto& tasks = *std::find_if(m_tasks.begin(), m_tasks.end(), [](const auto& tasks){ return !tasks.empty(); });
+                auto task = std::move(tasks.front());
+                tasks.pop_front();
                 lock.unlock();
                 try {
                     task();
@@ -24,8 +26,13 @@ void ThreadPool::createThreadPool() {
     }
 }
 
-ThreadPool::ThreadPool(size_t numThreads) : 
-m_numThreads{std::max(numThreads, static_cast<size_t>(1))}
+bool ThreadPool::hasTasks() const {
+    return std::any_of(m_tasks.begin(), m_tasks.end(), [](const auto& tasks){ return !tasks.empty(); });
+}
+
+ThreadPool::ThreadPool(size_t numThreads, size_t maxQueuedTasks) : 
+m_numThreads{std::max(numThreads, static_cast<size_t>(1))},
+m_maxQueuedTasks{std::max(maxQueuedTasks, static_cast<size_t>(1))}
 {
     createThreadPool();
 }
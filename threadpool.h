@@ -1,6 +1,7 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <array>
 #include <vector>
 #include <deque>
 #include <functional>
@@ -9,27 +10,39 @@
 #include <mutex>
 #include <thread>
 
+// Workers always drain higher priority tasks first
+enum class TaskPriority : size_t {
+    Normal = 0,
+    Low = 1,
+};
+inline const size_t NUM_TASK_PRIORITIES = 2;
 
 class ThreadPool {
-    std::deque<std::function<void()>> m_tasks;
+    std::array<std::deque<std::function<void()>>, NUM_TASK_PRIORITIES> m_tasks;
     std::vector<std::jthread> m_threads;
     std::mutex m_tasksMtx;
     std::condition_variable m_tasksCv;
     size_t m_numThreads;
+    size_t m_maxQueuedTasks;
     std::stop_source m_stopSource;
 
     void createThreadPool();
+    bool hasTasks() const;
 
 public:
-    ThreadPool(size_t numThreads=8);
+    ThreadPool(size_t numThreads=8, size_t maxQueuedTasks=1024);
     ~ThreadPool();
     void stop();
 
+    // returns false without queueing the task when its priority's queue already holds maxQueuedTasks
     template <typename T>
-    inline void addTask(T&& task) {
+    inline bool addTask(T&& task, TaskPriority priority = TaskPriority::Normal) {
         std::unique_lock<std::mutex> lock(m_tasksMtx);
-        m_tasks.push_back(std::forward<T>(task));
+        auto& tasks = m_tasks[static_cast<size_t>(priority)];
+        if (tasks.size() >= m_maxQueuedTasks) return false;
+        tasks.push_back(std::forward<T>(task));
         m_tasksCv.notify_one();
+        return true;
     }
 };
-#endif // THREADPOOL_H
\ No newline at end of file
+#endif // THREADPOOL_H
@@ -8,10 +8,14 @@
 #include <cstring>
 #include <format>
 #include <cstdint>
+#include <chrono>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
+// frames claiming to be larger are rejected before anything is allocated for them
+inline const uint32_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
 inline void cleanup(int socketFd) {
     if (close(socketFd) == -1)
         perror("Couldn't close socket");
@@ -49,6 +53,8 @@ inline std::string getMessage(int socketFd) {
     }
 
     uint32_t len = ntohl(len_n);
+    if (len > MAX_MESSAGE_SIZE)
+        throw std::runtime_error(std::format("Message of {} bytes is larger than the {} byte limit", len, MAX_MESSAGE_SIZE));
 
     std::vector<char> buffer(len);
     ret = recv(socketFd, buffer.data(), len, MSG_WAITALL);
@@ -81,6 +87,10 @@ inline int getSocketFd() {
     return socketfd;
 }
 
+inline uint64_t getCurrentTimeMs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
 template <typename T>
 inline T stringToVal(const std::string& val) {
     size_t idx{0};